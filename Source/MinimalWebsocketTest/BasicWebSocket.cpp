@@ -2,6 +2,20 @@
 
 DEFINE_LOG_CATEGORY(MiniWebSocket);
 
+// Separates messages batched into a single text frame. Only used once batching has been negotiated, at which point the server has agreed not to put it inside a message.
+static const TCHAR* BatchSeparator = TEXT("\x1E");
+
+// Compressed frames are sent as binary: magic, uncompressed size, compressed size (both int32, little endian), then the zlib stream.
+// Carrying the compressed size means we can find the end of the frame without any help from the websocket backend.
+static const uint8 CompressedFrameMagic[4] = { 'M', 'W', 'Z', '2' };
+static const int32 CompressedFrameHeaderSize = sizeof(CompressedFrameMagic) + 2 * sizeof(int32);
+
+// Not worth compressing anything smaller than this, it'll go out as a plain text frame instead
+static const int32 MinCompressedFrameSize = 256;
+
+// Hard cap on a single message, in either direction and whatever the negotiated MaxFrameSize is. Anything bigger is dropped.
+static const int32 MaxMessageSize = 16 * 1024 * 1024;
+
 void UBasicWebSocket::Initialise(const FString PlayerNameIn, const FString PlayerIDIn, const FString GameVersionIn)
 {
     bWantToConnect = true;
@@ -42,12 +56,18 @@ void UBasicWebSocket::Initialise(const FString PlayerNameIn, const FString Playe
         }
         UE_LOG(MiniWebSocket, Verbose, TEXT("Connected, requesting authentication"));
 
+        // Everything up to and including the authentication reply is spoken in the baseline protocol
+        NegotiatedProtocol = FNegotiatedProtocol();
+        InboundRawBuffer.Reset();
+        InboundRawBytesRemaining = 0;
+
         FRequestAuthenticationPayload Payload;
         Payload.PlayerName = PlayerName;
         Payload.PlayerID = PlayerID;
         Payload.GameVersion = GameVersion;
+        Payload.Capabilities = ClientCapabilities;
         
-        UE_LOG(MiniWebSocket, Verbose, TEXT("Payload's \"PlayerName\" and \"PlayerID\" set"));
+        UE_LOG(MiniWebSocket, Verbose, TEXT("Payload's \"PlayerName\", \"PlayerID\" and \"Capabilities\" set"));
         
         if (Socket)
         {
@@ -75,6 +95,11 @@ void UBasicWebSocket::Initialise(const FString PlayerNameIn, const FString Playe
             bIsAuthenticated = false;
         }
         
+        // Whatever we negotiated only lasted as long as this connection
+        NegotiatedProtocol = FNegotiatedProtocol();
+        InboundRawBuffer.Reset();
+        InboundRawBytesRemaining = 0;
+        
         // This code will run when the connection to the server has been terminated.
         // Because of an error or a call to Socket->Close().
     });
@@ -85,6 +110,12 @@ void UBasicWebSocket::Initialise(const FString PlayerNameIn, const FString Playe
     Socket->OnRawMessage().AddLambda([this](const void* Data, SIZE_T Size, SIZE_T BytesRemaining) -> void {
         UE_LOG(MiniWebSocket, VeryVerbose, TEXT("Raw Message received of size: %d with %d bytes remaining (last string message length was %d)"), Size, BytesRemaining, LastStringMessageLength);
         // This code will run when we receive a raw (binary) message from the server.
+        // The only binary frames we understand are compressed ones, so don't bother unless that's been negotiated.
+        if (NegotiatedProtocol.Compression == EWebSocketCompression::None)
+        {
+            return;
+        }
+        HandleInboundRawData(static_cast<const uint8*>(Data), Size);
     });
 
     //Socket->OnMessageSent().AddLambda([](const FString& MessageString) -> void {
@@ -144,12 +175,60 @@ void UBasicWebSocket::FlushMessageOutQueue()
     
     // Finally, actually go through the queue and send messages.
     FString MessageOut;
+    FString Batch;
+    int32 BatchBytes = 0;
     while (MessageOutQueue.Dequeue(MessageOut))
     {
         //SendMessage(MessageOut);
+        const bool bHasFrameSizeLimit = NegotiatedProtocol.MaxFrameSize > 0;
+        // A TCHAR never takes more than 3 bytes of UTF-8, so short messages can skip the conversion when there's no frame size to worry about
+        const bool bNeedsMessageBytes = bHasFrameSizeLimit || NegotiatedProtocol.bBatching || MessageOut.Len() * 3 > MaxMessageSize;
+        const int32 MessageBytes = bNeedsMessageBytes ? FTCHARToUTF8(*MessageOut, MessageOut.Len()).Length() : 0;
+        if (MessageBytes > MaxMessageSize)
+        {
+            // The server would drop it anyway, same as we do with anything this big coming the other way
+            UE_LOG(MiniWebSocket, Warning, TEXT("Dropping message of %d bytes, over the %d byte message size cap"), MessageBytes, MaxMessageSize);
+            OnInternalErrorMessage.Broadcast(FString::Printf(TEXT("Message of %d bytes is too big to send"), MessageBytes));
+            continue;
+        }
         UE_LOG(MiniWebSocket, Log, TEXT("... sending message: %s"), *MessageOut);
         OnMessageSent.Broadcast(MessageOut, FDateTime::Now());
-        Socket->Send(MessageOut);
+        if (bHasFrameSizeLimit && MessageBytes > NegotiatedProtocol.MaxFrameSize)
+        {
+            // We can't split a single message, so it still goes out whole in its own frame
+            UE_LOG(MiniWebSocket, Warning, TEXT("Message of %d bytes is over the negotiated max frame size of %d, sending it anyway"), MessageBytes, NegotiatedProtocol.MaxFrameSize);
+            if (!Batch.IsEmpty())
+            {
+                SendFrame(Batch);
+                Batch.Reset();
+                BatchBytes = 0;
+            }
+            SendFrame(MessageOut);
+            continue;
+        }
+        if (!NegotiatedProtocol.bBatching)
+        {
+            SendFrame(MessageOut);
+            continue;
+        }
+        // Start a new frame if this message would push the current one over the size limit
+        if (!Batch.IsEmpty() && NegotiatedProtocol.MaxFrameSize > 0 && BatchBytes + 1 + MessageBytes > NegotiatedProtocol.MaxFrameSize)
+        {
+            SendFrame(Batch);
+            Batch.Reset();
+            BatchBytes = 0;
+        }
+        if (!Batch.IsEmpty())
+        {
+            Batch += BatchSeparator;
+            BatchBytes += 1;
+        }
+        Batch += MessageOut;
+        BatchBytes += MessageBytes;
+    }
+    if (!Batch.IsEmpty())
+    {
+        SendFrame(Batch);
     }
     
     
@@ -211,6 +290,28 @@ EWebSocketMessageType UBasicWebSocket::WSMessageTypeStringToEnum(const FString M
     return (EWebSocketMessageType)StaticEnum<EWebSocketMessageType>()->GetValueByNameString(MessageTypeString);
 };
 
+FString UBasicWebSocket::WSCodecEnumToString(const EWebSocketCodec Codec)
+{
+    return StaticEnum<EWebSocketCodec>()->GetNameStringByValue((int64)Codec);
+};
+
+EWebSocketCodec UBasicWebSocket::WSCodecStringToEnum(const FString CodecString)
+{
+    const int64 Value = StaticEnum<EWebSocketCodec>()->GetValueByNameString(CodecString);
+    return Value == INDEX_NONE ? EWebSocketCodec::INVALID : (EWebSocketCodec)Value;
+};
+
+FString UBasicWebSocket::WSCompressionEnumToString(const EWebSocketCompression Compression)
+{
+    return StaticEnum<EWebSocketCompression>()->GetNameStringByValue((int64)Compression);
+};
+
+EWebSocketCompression UBasicWebSocket::WSCompressionStringToEnum(const FString CompressionString)
+{
+    const int64 Value = StaticEnum<EWebSocketCompression>()->GetValueByNameString(CompressionString);
+    return Value == INDEX_NONE ? EWebSocketCompression::INVALID : (EWebSocketCompression)Value;
+};
+
 
 // Stringify and send a message from enum and payload
 template<typename MessageDataType>
@@ -223,8 +324,9 @@ template<typename MessageDataType>
 FString UBasicWebSocket::ConvertMessageToString(EWebSocketMessageType MessageType, MessageDataType MessageData)
 {
     FString MessageString;
-    // Convert the struct part to json
-    FJsonObjectConverter::UStructToJsonObjectString(MessageData, MessageString, 0, 0, 2);
+    // Convert the struct part to json, leaving out the whitespace if the server is happy without it
+    const bool bPrettyPrint = NegotiatedProtocol.Codec != EWebSocketCodec::JsonCondensed;
+    FJsonObjectConverter::UStructToJsonObjectString(MessageData, MessageString, 0, 0, 2, nullptr, bPrettyPrint);
 
     // Add the message type on the front
     MessageString = WSMessageTypeEnumToString(MessageType) + "\n" + MessageString;
@@ -297,6 +399,255 @@ void UBasicWebSocket::PlayerAuthenticatedDelegate(const FPlayerAuthenticatedPayl
 };
 
 
+void UBasicWebSocket::ApplyNegotiatedProtocol(const FNegotiatedProtocol & ServerChoice)
+{
+    // Start from the baseline and only take what we actually offered
+    FNegotiatedProtocol Protocol;
+    
+    if (ServerChoice.ProtocolVersion < FProtocolCapabilities::CurrentProtocolVersion || ClientCapabilities.ProtocolVersion < FProtocolCapabilities::CurrentProtocolVersion)
+    {
+        UE_LOG(MiniWebSocket, Log, TEXT("Server is on protocol version %d, sticking with the baseline protocol"), ServerChoice.ProtocolVersion);
+        NegotiatedProtocol = Protocol;
+        return;
+    }
+    Protocol.ProtocolVersion = FMath::Min(ServerChoice.ProtocolVersion, ClientCapabilities.ProtocolVersion);
+    
+    if (ClientCapabilities.SupportedCodecs.Contains(ServerChoice.Codec))
+    {
+        Protocol.Codec = ServerChoice.Codec;
+    }
+    else
+    {
+        UE_LOG(MiniWebSocket, Warning, TEXT("Server picked codec \"%s\", which we didn't offer, falling back to \"%s\""), *WSCodecEnumToString(ServerChoice.Codec), *WSCodecEnumToString(Protocol.Codec));
+    }
+    
+    if (ClientCapabilities.SupportedCompression.Contains(ServerChoice.Compression))
+    {
+        Protocol.Compression = ServerChoice.Compression;
+    }
+    else
+    {
+        UE_LOG(MiniWebSocket, Warning, TEXT("Server picked compression \"%s\", which we didn't offer, falling back to \"%s\""), *WSCompressionEnumToString(ServerChoice.Compression), *WSCompressionEnumToString(Protocol.Compression));
+    }
+    
+    Protocol.bBatching = ServerChoice.bBatching && ClientCapabilities.bSupportsBatching;
+    Protocol.bTopics = ServerChoice.bTopics && ClientCapabilities.bSupportsTopics;
+    // 0 means no limit, otherwise the smaller of the two limits is the one we can both live with
+    const int32 ServerMaxFrameSize = FMath::Max(ServerChoice.MaxFrameSize, 0);
+    const int32 ClientMaxFrameSize = FMath::Max(ClientCapabilities.MaxFrameSize, 0);
+    if (ServerMaxFrameSize == 0 || ClientMaxFrameSize == 0)
+    {
+        Protocol.MaxFrameSize = FMath::Max(ServerMaxFrameSize, ClientMaxFrameSize);
+    }
+    else
+    {
+        Protocol.MaxFrameSize = FMath::Min(ServerMaxFrameSize, ClientMaxFrameSize);
+    }
+    
+    NegotiatedProtocol = Protocol;
+    UE_LOG(MiniWebSocket, Log, TEXT("Negotiated protocol version %d, codec: %s, compression: %s, batching: %s, topics: %s, max frame size: %d"),
+        NegotiatedProtocol.ProtocolVersion, *WSCodecEnumToString(NegotiatedProtocol.Codec), *WSCompressionEnumToString(NegotiatedProtocol.Compression),
+        NegotiatedProtocol.bBatching ? TEXT("on") : TEXT("off"), NegotiatedProtocol.bTopics ? TEXT("on") : TEXT("off"), NegotiatedProtocol.MaxFrameSize);
+};
+
+void UBasicWebSocket::SendFrame(const FString & Frame)
+{
+    if (!Socket)
+    {
+        return;
+    }
+    if (NegotiatedProtocol.Compression != EWebSocketCompression::Zlib)
+    {
+        Socket->Send(Frame);
+        return;
+    }
+    
+    FTCHARToUTF8 Utf8Frame(*Frame, Frame.Len());
+    const int32 UncompressedSize = Utf8Frame.Length();
+    if (UncompressedSize < MinCompressedFrameSize)
+    {
+        Socket->Send(Frame);
+        return;
+    }
+    
+    int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, UncompressedSize);
+    TArray<uint8> Buffer;
+    Buffer.SetNumUninitialized(CompressedFrameHeaderSize + CompressedSize);
+    FMemory::Memcpy(Buffer.GetData(), CompressedFrameMagic, sizeof(CompressedFrameMagic));
+    FMemory::Memcpy(Buffer.GetData() + sizeof(CompressedFrameMagic), &UncompressedSize, sizeof(int32));
+    
+    if (!FCompression::CompressMemory(NAME_Zlib, Buffer.GetData() + CompressedFrameHeaderSize, CompressedSize, Utf8Frame.Get(), UncompressedSize))
+    {
+        UE_LOG(MiniWebSocket, Warning, TEXT("Failed to compress frame of %d bytes, sending it uncompressed"), UncompressedSize);
+        Socket->Send(Frame);
+        return;
+    }
+    Buffer.SetNum(CompressedFrameHeaderSize + CompressedSize);
+    FMemory::Memcpy(Buffer.GetData() + sizeof(CompressedFrameMagic) + sizeof(int32), &CompressedSize, sizeof(int32));
+    UE_LOG(MiniWebSocket, VeryVerbose, TEXT("Compressed frame from %d to %d bytes"), UncompressedSize, Buffer.Num());
+    Socket->Send(Buffer.GetData(), Buffer.Num(), true);
+};
+
+void UBasicWebSocket::HandleInboundRawData(const uint8* Data, SIZE_T Size)
+{
+    // NOTE: In 4.25 OnRawMessage fires for text frames as well as binary ones, with no way to tell them apart, and its BytesRemaining
+    // only covers the current websocket fragment (it's lws_remaining_packet_payload in the LWS backend), not the whole message.
+    // So rather than trusting either, compressed frames carry their own length and we reassemble on that.
+    if (InboundRawBytesRemaining == 0)
+    {
+        // Anything that doesn't start with a compressed frame header is a text frame (or the rest of one), which OnMessage deals with
+        if (Size < static_cast<SIZE_T>(CompressedFrameHeaderSize) || FMemory::Memcmp(Data, CompressedFrameMagic, sizeof(CompressedFrameMagic)) != 0)
+        {
+            return;
+        }
+        int32 UncompressedSize = 0;
+        int32 CompressedSize = 0;
+        FMemory::Memcpy(&UncompressedSize, Data + sizeof(CompressedFrameMagic), sizeof(int32));
+        FMemory::Memcpy(&CompressedSize, Data + sizeof(CompressedFrameMagic) + sizeof(int32), sizeof(int32));
+        if (UncompressedSize <= 0 || UncompressedSize > MaxMessageSize
+            || CompressedSize <= 0 || CompressedSize > FCompression::CompressMemoryBound(NAME_Zlib, MaxMessageSize))
+        {
+            // The rest of this frame won't start with a header, so it gets skipped along with any text frames
+            UE_LOG(MiniWebSocket, Warning, TEXT("Dropping compressed frame of %d bytes (%d uncompressed), over the %d byte message size cap"), CompressedSize, UncompressedSize, MaxMessageSize);
+            OnInternalErrorMessage.Broadcast(FString::Printf(TEXT("Dropped a %d byte message from the server, it was too big"), UncompressedSize));
+            return;
+        }
+        InboundRawBuffer.Reset(CompressedFrameHeaderSize + CompressedSize);
+        InboundRawBytesRemaining = CompressedFrameHeaderSize + CompressedSize;
+    }
+    
+    // One compressed frame per websocket message, so anything past its end isn't ours. What's left is bounded by the cap, so it fits in an int32.
+    const int32 BytesToTake = static_cast<int32>(FMath::Min(Size, static_cast<SIZE_T>(InboundRawBytesRemaining)));
+    InboundRawBuffer.Append(Data, BytesToTake);
+    InboundRawBytesRemaining -= BytesToTake;
+    if (InboundRawBytesRemaining == 0)
+    {
+        // Moved out first, as handling the frame may end up back in here
+        TArray<uint8> Frame = MoveTemp(InboundRawBuffer);
+        InboundRawBuffer.Reset();
+        HandleInboundBinaryFrame(Frame);
+    }
+};
+
+void UBasicWebSocket::HandleInboundBinaryFrame(const TArray<uint8> & Frame)
+{
+    // Sizes have already been checked against the cap while the frame was being reassembled
+    int32 UncompressedSize = 0;
+    FMemory::Memcpy(&UncompressedSize, Frame.GetData() + sizeof(CompressedFrameMagic), sizeof(int32));
+    if (NegotiatedProtocol.MaxFrameSize > 0 && UncompressedSize > NegotiatedProtocol.MaxFrameSize)
+    {
+        UE_LOG(MiniWebSocket, Warning, TEXT("Received message of %d bytes, over the negotiated max frame size of %d, accepting it anyway"), UncompressedSize, NegotiatedProtocol.MaxFrameSize);
+    }
+    
+    TArray<uint8> Uncompressed;
+    Uncompressed.SetNumUninitialized(UncompressedSize);
+    if (!FCompression::UncompressMemory(NAME_Zlib, Uncompressed.GetData(), UncompressedSize, Frame.GetData() + CompressedFrameHeaderSize, Frame.Num() - CompressedFrameHeaderSize))
+    {
+        UE_LOG(MiniWebSocket, Warning, TEXT("Failed to decompress frame of %d bytes"), Frame.Num());
+        OnInternalErrorMessage.Broadcast("Failed to decompress a message from the server");
+        return;
+    }
+    
+    FUTF8ToTCHAR Message(reinterpret_cast<const ANSICHAR*>(Uncompressed.GetData()), Uncompressed.Num());
+    HandleInboundMessage(FString(Message.Length(), Message.Get()));
+};
+
+
+void UBasicWebSocket::Subscribe(const FString Topic, const float MaxUpdateRateHz)
+{
+    if (Topic.IsEmpty())
+    {
+        UE_LOG(MiniWebSocket, Warning, TEXT("Can't subscribe to a topic without a name"));
+        return;
+    }
+    // The topic is its own line in a TopicMessage, so a newline (or a batch separator) would mean we could never match its updates
+    if (Topic.Contains(TEXT("\n"), ESearchCase::CaseSensitive) || Topic.Contains(BatchSeparator, ESearchCase::CaseSensitive))
+    {
+        UE_LOG(MiniWebSocket, Warning, TEXT("Can't subscribe to topic \"%s\", topic names can't contain newlines or the batch separator"), *Topic.ReplaceCharWithEscapedChar());
+        return;
+    }
+    Subscriptions.Add(Topic, FMath::Max(MaxUpdateRateHz, 0.f));
+    
+    // If we aren't authenticated yet, this will go out with the rest of our subscriptions once we are
+    if (bIsAuthenticated && NegotiatedProtocol.bTopics)
+    {
+        FSubscribePayload Payload;
+        Payload.Topic = Topic;
+        Payload.MaxUpdateRateHz = Subscriptions[Topic];
+        SendMessage(EWebSocketMessageType::Subscribe, Payload);
+    }
+};
+
+void UBasicWebSocket::Unsubscribe(const FString Topic)
+{
+    if (Subscriptions.Remove(Topic) == 0)
+    {
+        return;
+    }
+    // The server won't know about it if we aren't authenticated (or it doesn't do topics), so nothing to tell it
+    if (bIsAuthenticated && NegotiatedProtocol.bTopics)
+    {
+        FUnsubscribePayload Payload;
+        Payload.Topic = Topic;
+        SendMessage(EWebSocketMessageType::Unsubscribe, Payload);
+    }
+};
+
+void UBasicWebSocket::RestoreSubscriptions()
+{
+    // Queued Subscribe/Unsubscribe messages may be for topics we've changed our minds about since, and the full set goes out below anyway
+    const FString SubscribePrefix = WSMessageTypeEnumToString(EWebSocketMessageType::Subscribe) + "\n";
+    const FString UnsubscribePrefix = WSMessageTypeEnumToString(EWebSocketMessageType::Unsubscribe) + "\n";
+    TArray<FString> KeptMessages;
+    FString QueuedMessage;
+    while (MessageOutQueue.Dequeue(QueuedMessage))
+    {
+        if (!QueuedMessage.StartsWith(SubscribePrefix, ESearchCase::CaseSensitive) && !QueuedMessage.StartsWith(UnsubscribePrefix, ESearchCase::CaseSensitive))
+        {
+            KeptMessages.Add(MoveTemp(QueuedMessage));
+        }
+    }
+    for (FString & KeptMessage : KeptMessages)
+    {
+        MessageOutQueue.Enqueue(MoveTemp(KeptMessage));
+    }
+    
+    // Servers that don't do topics would only get confused by these
+    if (!NegotiatedProtocol.bTopics || Subscriptions.Num() == 0)
+    {
+        return;
+    }
+    
+    // Bypass the queue like the ping does, otherwise these would sit there until the pong comes back and the server would stream its defaults in the meantime
+    UE_LOG(MiniWebSocket, Log, TEXT("Restoring %d topic subscriptions"), Subscriptions.Num());
+    for (const TPair<FString, float> & Subscription : Subscriptions)
+    {
+        FSubscribePayload Payload;
+        Payload.Topic = Subscription.Key;
+        Payload.MaxUpdateRateHz = Subscription.Value;
+        SendFrame(ConvertMessageToString(EWebSocketMessageType::Subscribe, Payload));
+    }
+};
+
+bool UBasicWebSocket::ParseTopicMessage(const FString & MessageDataString, FTopicMessagePayload & OutTopicData) const
+{
+    // First line is the topic, the rest is the payload
+    if (!MessageDataString.Split("\n", &OutTopicData.Topic, &OutTopicData.Data))
+    {
+        OutTopicData.Topic = MessageDataString;
+        OutTopicData.Data.Reset();
+    }
+    
+    // Updates can still be in flight after we unsubscribe, no need to bother anyone with them
+    if (!Subscriptions.Contains(OutTopicData.Topic))
+    {
+        UE_LOG(MiniWebSocket, VeryVerbose, TEXT("Dropping message for topic we're not subscribed to: %s"), *OutTopicData.Topic);
+        return false;
+    }
+    return true;
+};
+
+
 void UBasicWebSocket::DisconnectFromServer()
 {
     UE_LOG(MiniWebSocket, Log, TEXT("Disconnecting websocket..."));
@@ -350,10 +701,29 @@ void UBasicWebSocket::HandleInboundMessage(const FString & Message)
         DisconnectFromServer();
         return;
     }
+    // Batched frames get unpacked and each message handled on its own
+    if (NegotiatedProtocol.bBatching && Message.Contains(BatchSeparator, ESearchCase::CaseSensitive))
+    {
+        TArray<FString> BatchedMessages;
+        Message.ParseIntoArray(BatchedMessages, BatchSeparator, true);
+        for (const FString & BatchedMessage : BatchedMessages)
+        {
+            HandleInboundMessage(BatchedMessage);
+        }
+        return;
+    }
     // If we get any message from the server, that means it's live
     ConnectionIsLive = true;
     LastStringMessageLength = Message.Len();
     
+    // Same cap as for compressed frames and outgoing messages. Len() undercounts the UTF-8 size, so this is on the generous side.
+    if (LastStringMessageLength > MaxMessageSize)
+    {
+        UE_LOG(MiniWebSocket, Warning, TEXT("Dropping text message of length %d, over the %d byte message size cap"), LastStringMessageLength, MaxMessageSize);
+        OnInternalErrorMessage.Broadcast(FString::Printf(TEXT("Dropped a %d character message from the server, it was too big"), LastStringMessageLength));
+        return;
+    }
+    
 
     FString MessageTypeString, MessageDataString;
     
@@ -367,6 +737,25 @@ void UBasicWebSocket::HandleInboundMessage(const FString & Message)
         UE_LOG(MiniWebSocket, Verbose, TEXT("String Message received of length %d: %s"), LastStringMessageLength, *Message);
     }
     
+    // Filter out topics we've dropped before anyone gets to hear about them
+    FTopicMessagePayload TopicData;
+    if (MessageType == EWebSocketMessageType::TopicMessage && !ParseTopicMessage(MessageDataString, TopicData))
+    {
+        return;
+    }
+    
+    // Switch protocol before any listener gets the chance to send something, so everything after this reply already uses it
+    FPlayerAuthenticatedPayload AuthenticatedData;
+    if (MessageType == EWebSocketMessageType::PlayerAuthenticated)
+    {
+        FJsonObjectConverter::JsonObjectStringToUStruct(MessageDataString, &AuthenticatedData, 0, 0);
+        ApplyNegotiatedProtocol(AuthenticatedData.Protocol);
+        // Listeners may want to Subscribe straight away, which only goes out once we're authenticated
+        bIsAuthenticated = true;
+        // The server forgets our subscriptions when the connection drops, so tell it again before the ping holds up the queue
+        RestoreSubscriptions();
+    }
+    
     OnMessageReceived.Broadcast(Message, FDateTime::Now());
     
     switch (MessageType)
@@ -374,13 +763,16 @@ void UBasicWebSocket::HandleInboundMessage(const FString & Message)
         case EWebSocketMessageType::PlayerAuthenticated:
             UE_LOG(MiniWebSocket, Verbose, TEXT("Player authenticated"));        
 
-            BroadcastMessageEvent<FPlayerAuthenticatedPayload>(OnPlayerAuthenticated, MessageDataString);
+            OnPlayerAuthenticated.Broadcast(AuthenticatedData);
             break;
         case EWebSocketMessageType::Pong:
             HandlePongMessage(MessageDataString);
             // if we got a pong, chances are we sent a ping and may have blocked some messages from being sent while waiting for it
             FlushMessageOutQueue();
             break;
+        case EWebSocketMessageType::TopicMessage:
+            OnTopicMessage.Broadcast(TopicData);
+            break;
             
         case EWebSocketMessageType::WarningMessage:
             UE_LOG(MiniWebSocket, Warning, TEXT("Received a warning message from server:\n %s"), *MessageDataString);
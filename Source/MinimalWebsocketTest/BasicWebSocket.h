@@ -17,6 +17,7 @@
 #include "Misc/Timespan.h"
 #include "Containers/UnrealString.h"
 #include "Modules/ModuleManager.h"
+#include "Misc/Compression.h"
 
 #include "BasicWebSocket.generated.h"
 
@@ -32,10 +33,97 @@ enum class EWebSocketMessageType : uint8
     ErrorMessage,
     Ping,
     Pong,
+    Subscribe,
+    Unsubscribe,
+    TopicMessage,
 
     INVALID
 };
 
+// Protocol negotiation. Codecs and compression go over the wire by their enum names, e.g. "JsonCondensed" or "Zlib".
+
+/// How message payloads are written out. Json (pretty printed) is the baseline every server understands.
+UENUM(BlueprintType)
+enum class EWebSocketCodec : uint8
+{
+    Json,
+    JsonCondensed,
+
+    INVALID
+};
+
+/// Per-frame compression schemes. None is the baseline.
+UENUM(BlueprintType)
+enum class EWebSocketCompression : uint8
+{
+    None,
+    Zlib,
+
+    INVALID
+};
+
+/// What this client is able to speak. Sent along with the authentication request, servers that don't know about it just ignore it.
+USTRUCT(BlueprintType)
+struct FProtocolCapabilities
+{
+    GENERATED_BODY()
+
+    /// Version 1 is the original text protocol, version 2 adds capability negotiation.
+    static constexpr int32 BaselineProtocolVersion = 1;
+    static constexpr int32 CurrentProtocolVersion = 2;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    int32 ProtocolVersion = CurrentProtocolVersion;
+
+    // In order of preference
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    TArray<EWebSocketCodec> SupportedCodecs = { EWebSocketCodec::JsonCondensed, EWebSocketCodec::Json };
+
+    // In order of preference
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    TArray<EWebSocketCompression> SupportedCompression = { EWebSocketCompression::Zlib, EWebSocketCompression::None };
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    bool bSupportsBatching = true;
+
+    // Subscribe/Unsubscribe/TopicMessage
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    bool bSupportsTopics = true;
+
+    // Largest frame (in bytes) we are happy to receive. 0 means no limit.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    int32 MaxFrameSize = 65536;
+};
+
+/// The mode the server picked from our capabilities. The defaults are the baseline text protocol, which is what we end up with if the server is too old to send this back.
+USTRUCT(BlueprintType)
+struct FNegotiatedProtocol
+{
+    GENERATED_BODY()
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    int32 ProtocolVersion = FProtocolCapabilities::BaselineProtocolVersion;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    EWebSocketCodec Codec = EWebSocketCodec::Json;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    EWebSocketCompression Compression = EWebSocketCompression::None;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    bool bBatching = false;
+
+    // Whether the server understands topic subscriptions. Until it does, we keep them to ourselves.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    bool bTopics = false;
+
+    // Largest frame (in bytes) either side should send. 0 means no limit.
+    // Batches are split to stay under it. A single message that's bigger still goes out (and is accepted) whole, with a warning,
+    // up to a hard cap of 16 MB. Anything over that is dropped in both directions.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    int32 MaxFrameSize = 0;
+};
+
 // Client -> Server messages
 
 USTRUCT(BlueprintType)
@@ -51,6 +139,9 @@ struct FRequestAuthenticationPayload
     
     UPROPERTY(EditAnywhere, BlueprintReadWrite)
     FString GameVersion;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    FProtocolCapabilities Capabilities;
 };
 
 USTRUCT(BlueprintType)
@@ -71,6 +162,28 @@ struct FPingPayload
     FTimespan CurrentServerTimeOffsetEstimate;
 };
 
+USTRUCT(BlueprintType)
+struct FSubscribePayload
+{
+    GENERATED_BODY()
+    
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    FString Topic;
+    
+    // Most updates per second the server should send us for this topic. 0 means no cap.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    float MaxUpdateRateHz = 0.f;
+};
+
+USTRUCT(BlueprintType)
+struct FUnsubscribePayload
+{
+    GENERATED_BODY()
+    
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    FString Topic;
+};
+
 
 // Server -> Client messages
 
@@ -85,6 +198,9 @@ struct FPlayerAuthenticatedPayload
     UPROPERTY(EditAnywhere, BlueprintReadWrite)
     FString PlayerID;
 
+    // Left at the baseline defaults by servers that don't negotiate
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    FNegotiatedProtocol Protocol;
 };
 
 USTRUCT(BlueprintType)
@@ -100,12 +216,31 @@ struct FPongPayload
     
 };
 
+/// Not JSON on the wire, so the payload doesn't have to be encoded twice. The message looks like:
+///   TopicMessage
+///   <topic>
+///   <payload, passed through untouched like WarningMessage/ErrorMessage bodies>
+/// So topic names can't contain a newline (or the \x1E batch separator), and Subscribe refuses any that do.
+USTRUCT(BlueprintType)
+struct FTopicMessagePayload
+{
+    GENERATED_BODY();
+    
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    FString Topic;
+    
+    // Everything after the topic line, exactly as the server sent it
+    UPROPERTY(EditAnywhere, BlueprintReadWrite)
+    FString Data;
+};
+
 
 // Delegate definitions
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnMessageSent, FString, MessageString, FDateTime, TimeStamp);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnMessageReceived, FString, MessageString, FDateTime, TimeStamp);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnPlayerAuthenticated, FPlayerAuthenticatedPayload, MessageData);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnTopicMessage, FTopicMessagePayload, MessageData);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnWarningMessage, FString, WarningMessage);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnErrorMessage, FString, ErrorMessage);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnInternalErrorMessage, FString, ErrorMessage);
@@ -130,6 +265,9 @@ public:
     UPROPERTY(BlueprintAssignable)
     FOnPlayerAuthenticated OnPlayerAuthenticated;
 
+    UPROPERTY(BlueprintAssignable)
+    FOnTopicMessage OnTopicMessage;
+
     UPROPERTY(BlueprintAssignable)
     FOnWarningMessage OnWarningMessage;
     UPROPERTY(BlueprintAssignable)
@@ -176,6 +314,54 @@ public:
     UPROPERTY(BlueprintReadWrite)
     bool ConnectionIsLive = true;
 
+    // ------- Protocol negotiation --------
+
+    /// What we offer the server when requesting authentication. Trim this down to force a simpler protocol.
+    UPROPERTY(BlueprintReadWrite)
+    FProtocolCapabilities ClientCapabilities;
+
+    /// What we're currently speaking. Reset to the baseline whenever the connection (re)opens or closes.
+    UPROPERTY(BlueprintReadOnly)
+    FNegotiatedProtocol NegotiatedProtocol;
+
+    /// Switch to the protocol the server picked, falling back to the baseline for anything we didn't offer.
+    /// Only called when the PlayerAuthenticated reply arrives, before OnPlayerAuthenticated is broadcast.
+    void ApplyNegotiatedProtocol(const FNegotiatedProtocol & ServerChoice);
+
+    /// Send a single frame, compressing it if that's been negotiated
+    void SendFrame(const FString & Frame);
+
+    /// Handle a binary frame once all of its fragments have arrived
+    void HandleInboundBinaryFrame(const TArray<uint8> & Frame);
+
+    /// Reassemble compressed frames from whatever OnRawMessage hands us
+    void HandleInboundRawData(const uint8* Data, SIZE_T Size);
+
+    /// The compressed frame currently being received, and how many of its bytes are still to come
+    TArray<uint8> InboundRawBuffer;
+    int32 InboundRawBytesRemaining = 0;
+
+    // ------- Topic subscriptions --------
+
+    /// Topics we want updates for, mapped to their update rate cap (0 means no cap). Sent again every time we authenticate, so they survive reconnects.
+    UPROPERTY(BlueprintReadOnly)
+    TMap<FString, float> Subscriptions;
+
+    /// Ask the server for updates on a topic. Subscribing again to the same topic just changes its rate cap.
+    /// Only sent if the server negotiated topics, but it's remembered either way.
+    UFUNCTION(BlueprintCallable)
+    void Subscribe(const FString Topic, const float MaxUpdateRateHz = 0.f);
+
+    UFUNCTION(BlueprintCallable)
+    void Unsubscribe(const FString Topic);
+
+    /// Re-send all of our subscriptions straight away (not via the queue) after authenticating, if the server negotiated topics.
+    /// Any Subscribe/Unsubscribe still in the queue is dropped, as it's out of date by now.
+    void RestoreSubscriptions();
+
+    /// Split a TopicMessage body into topic and payload. Returns false if we're not subscribed to that topic (any more).
+    bool ParseTopicMessage(const FString & MessageDataString, FTopicMessagePayload & OutTopicData) const;
+
     UFUNCTION(BlueprintCallable)
     void Initialise(const FString PlayerNameIn, const FString PlayerIDIn, const FString GameVersionIn);
     
@@ -245,6 +431,18 @@ public:
     
     UFUNCTION(BlueprintPure)
     static EWebSocketMessageType WSMessageTypeStringToEnum(const FString MessageTypeString);    
+    
+    UFUNCTION(BlueprintPure)
+    static FString WSCodecEnumToString(const EWebSocketCodec Codec);
+    
+    UFUNCTION(BlueprintPure)
+    static EWebSocketCodec WSCodecStringToEnum(const FString CodecString);
+    
+    UFUNCTION(BlueprintPure)
+    static FString WSCompressionEnumToString(const EWebSocketCompression Compression);
+    
+    UFUNCTION(BlueprintPure)
+    static EWebSocketCompression WSCompressionStringToEnum(const FString CompressionString);
 
     // --------- Timer helper functions --------
     